@@ -0,0 +1,43 @@
+#ifndef folding_h
+#define folding_h
+
+#include <stddef.h>
+
+/* Detector response, folding energy histograms with a Gaussian resolution.
+ *
+ * The resolution is given as sigma(E)^2 = noise^2 + stochastic^2 * E +
+ * (constant * E)^2, with E in MeV. An optional efficiency (per bin of true
+ * energy) can be provided as well.
+ */
+struct folding_response;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct folding_response * folding_response_new(
+    size_t size,
+    const double * edges,
+    double noise,
+    double stochastic,
+    double constant,
+    const double * efficiency,
+    int density);
+
+void folding_response_destroy(struct folding_response * response);
+
+/* Fold a batch of histograms (stored contiguously). If squared is non zero,
+ * (uncorrelated) per-bin variances are propagated instead of values. */
+void folding_response_apply(
+    const struct folding_response * response,
+    size_t histograms,
+    const double * values,
+    double * result,
+    int squared,
+    int threads);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -2,11 +2,20 @@
 #define g4geometry_h
 
 /* Geant4 interface */
+#include "G4RotationMatrix.hh"
+#include "G4ThreeVector.hh"
 #include "G4VUserDetectorConstruction.hh"
 /* Goupil interface */
 #include "goupil.h"
 
 #include <array>
+#include <map>
+#include <string>
+#include <vector>
+
+class G4Box;
+class G4LogicalVolume;
+class G4Material;
 
 /*TODO Define in goupil.h */
 struct goupil_state {
@@ -23,7 +32,32 @@ struct DetectorConstruction : public G4VUserDetectorConstruction {
         G4VPhysicalVolume * Construct();
         
         void RandomiseState(struct goupil_state * state);
+        /* Bias the forward sampling of lines by the given (positive)
+         * factors, e.g. detection probabilities, one per line. Sampled
+         * states are weighted accordingly. A null pointer disables the
+         * biasing. Returns 0 on success, or -1 if the factors are invalid
+         * (in which case the biasing is disabled). */
+        int SetLineBias(size_t size, const double * factors);
+        size_t GetLines(double * energies, double * intensities);
         double RandomiseBackward(double alpha, struct goupil_state * state);
+        /* Restrict backward energies to the given analysis windows, as
+         * (min, max) pairs in MeV. An empty set removes the restriction.
+         * Returns 0 on success, or -1 if no source line contributes to the
+         * windows (in which case the restriction is removed). */
+        int SetWindows(size_t size, const double * windows);
+        
+        /* Normalisation (in cm^3) of an exponential source density,
+         * exp(-lambda * h), where h is the height above ground (in cm). */
+        double SourceNormalisation(double lambda);
+        
+        /* Place a copy of a repeated component. The solid and the logical
+         * volume are built once, on first placement, and then shared by all
+         * copies (which are distinguished by their copy number). */
+        G4LogicalVolume * PlaceInstance(const std::string& name,
+                G4double dim[3], G4Material * material,
+                G4RotationMatrix * rot, G4ThreeVector pos,
+                G4LogicalVolume * motherVolume, G4int copyNo);
+        void DropInstances();
         
         G4double worldSize[3], detectorSize[3];
         G4double airSize[3], groundSize[3];
@@ -33,7 +67,12 @@ struct DetectorConstruction : public G4VUserDetectorConstruction {
         DetectorConstruction();
         ~DetectorConstruction() override = default;
         
-        std::array<std::pair<double, double>, 11> spectrum = {
+        std::map<std::array<G4double, 3>, G4Box *> solids;
+        std::map<std::string, G4LogicalVolume *> instances;
+        
+        /* Number of emission lines, sizing all per line tables */
+        static constexpr size_t N_LINES = 11;
+        std::array<std::pair<double, double>, N_LINES> spectrum = {
             // Po^218 -> Pb^214.
             std::make_pair(0.242,  7.3),
             std::make_pair(0.295, 18.4),
@@ -48,6 +87,19 @@ struct DetectorConstruction : public G4VUserDetectorConstruction {
             std::make_pair(1.764, 15.3),
             std::make_pair(2.204,  4.9),
         };
+        
+        /* Biased forward sampling of lines */
+        bool biased = false;
+        std::array<double, N_LINES> biasCdf;
+        std::array<double, N_LINES> biasWeight;
+        
+        /* Backward sampling restricted to analysis windows */
+        std::vector<std::pair<double, double> > windows;
+        std::array<double, N_LINES> windowCdf;
+        std::array<double, N_LINES> windowLength;
+        std::array<bool, N_LINES> windowLine;
+        double windowNorm;
+        double RandomiseWindowed(double alpha, double * energy, double * weight);
 };
 
 #endif
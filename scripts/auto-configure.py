@@ -0,0 +1,116 @@
+#! /usr/bin/env python3
+import argparse
+import json
+import numpy
+import time
+
+import simulation
+
+
+def scores(events, windows, discrete):
+    """Return per event scores, for all observables."""
+    s, p = events.expected, events.primaries
+    weights = s["weight"] if events.weighted else numpy.ones(s.size)
+    weights = numpy.where(events.valid, weights, 0.0)
+    result = []
+    for emin, emax in windows:
+        sel = (s["energy"] >= emin) & (s["energy"] < emax)
+        result.append(numpy.where(sel, weights, 0.0))
+    if discrete:
+        sel = s["energy"] == p["energy"]
+        result.append(numpy.where(sel, weights, 0.0))
+    return numpy.array(result)
+
+
+def figure_of_merit(scores, cost):
+    """Return the figure of merit, 1 / (sigma_rel^2 * cost), per observable."""
+    n = scores.shape[1]
+    mean = numpy.mean(scores, axis=1)
+    var = numpy.var(scores, axis=1) / n
+    fom = numpy.zeros(mean.shape)
+    sel = (mean > 0.0) & (var > 0.0)
+    fom[sel] = mean[sel]**2 / (var[sel] * cost)
+    return fom
+
+
+def autoconfigure(sim, events, alphas, windows, discrete=False, verbose=True):
+    """Run timed pilot batches and return the most efficient configuration.
+
+    The configuration is scored by the smallest figure of merit over all
+    observables.
+    """
+    configurations = [{"mode": "forward"}]
+    configurations += [{"mode": "backward", "alpha": alpha} for alpha in alphas]
+
+    best = None
+    for config in configurations:
+        alpha = config.get("alpha", 0.5)
+        # Warm up the engine (including cross-sections tables), such that its
+        # one-time setup is excluded from timing.
+        sim.run(config["mode"], 1, alpha)
+        t0 = time.process_time()
+        data = sim.run(config["mode"], events, alpha)
+        cost = time.process_time() - t0
+        fom = figure_of_merit(scores(data, windows, discrete), cost)
+        config["fom"] = float(numpy.min(fom))
+        if verbose:
+            print(f"{json.dumps(config)} (pilot: {cost:.1f} s)")
+        if (best is None) or (config["fom"] > best["fom"]):
+            best = config
+    return best
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(
+        description="Select the transport mode and biasing from pilot runs."
+    )
+    parser.add_argument("-e", "--events",
+        help = "number of events per pilot run",
+        type = int,
+        default = 100000
+    )
+    parser.add_argument("-a", "--alphas",
+        help = "backward biasing parameters to test",
+        type = float,
+        nargs = "+",
+        default = [0.1, 0.3, 0.5, 0.7, 0.9]
+    )
+    parser.add_argument("-w", "--window",
+        help = "observed energy window (MeV), can be repeated",
+        type = float,
+        nargs = 2,
+        action = "append",
+        metavar = ("EMIN", "EMAX")
+    )
+    parser.add_argument("-d", "--discrete",
+        help = "observe the unscattered (discrete) flux as well",
+        action = "store_true"
+    )
+    parser.add_argument("-s", "--seed",
+        help = "pilot runs seed",
+        type = int,
+        default = None
+    )
+    parser.add_argument("-l", "--library",
+        help = "geometry library",
+        default = simulation.LIB_PATH
+    )
+    parser.add_argument("-o", "--output",
+        help = "apply the configuration, by writing it to a file "
+               "(see run-parallel.py)",
+        default = None
+    )
+
+    args = parser.parse_args()
+
+    windows = args.window or [(0.0, numpy.inf)]
+
+    sim = simulation.Simulation(args.library)
+    if args.seed is not None:
+        sim.seed(args.seed)
+    best = autoconfigure(sim, args.events, args.alphas, windows, args.discrete)
+    print(f"best: {json.dumps(best)}")
+
+    if args.output is not None:
+        with open(args.output, "w") as f:
+            json.dump(best, f)
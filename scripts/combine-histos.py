@@ -0,0 +1,144 @@
+#!/usr/bin/env python3
+import argparse
+import numpy
+import pickle
+
+import simulation
+
+
+VARIABLES = ("energy", "cos_theta", "distance")
+
+
+def histogram(n, values, weights, edges):
+    """Return the per event mean of scores and its variance, per bin."""
+    s0, _ = numpy.histogram(values, edges, weights=weights)
+    s1, _ = numpy.histogram(values, edges, weights=weights**2)
+    mean = s0 / n
+    var = numpy.maximum(s1 / n - mean**2, 0.0) / n
+    return mean, var
+
+
+def combine(forward, backward):
+    """Combine per bin estimates with inverse-variance weights.
+
+    Each argument is a (mean, variance) pair of arrays. Returns the combined
+    value, its standard error and the weight of the forward estimate.
+    """
+    (xf, vf), (xb, vb) = forward, backward
+    # Bins without any entry have a null variance estimate. They carry no
+    # information and are thus given an infinite variance.
+    vf = numpy.where(vf > 0.0, vf, numpy.inf)
+    vb = numpy.where(vb > 0.0, vb, numpy.inf)
+    with numpy.errstate(divide="ignore", invalid="ignore"):
+        wf = vb / (vf + vb)
+    wf = numpy.where(numpy.isinf(vf) & numpy.isinf(vb), 0.5, wf)
+    wf = numpy.where(numpy.isinf(vf) & ~numpy.isinf(vb), 0.0, wf)
+    wf = numpy.where(~numpy.isinf(vf) & numpy.isinf(vb), 1.0, wf)
+    wb = 1.0 - wf
+
+    value = wf * xf + wb * xb
+    vf = numpy.where(numpy.isinf(vf), 0.0, vf)
+    vb = numpy.where(numpy.isinf(vb), 0.0, vb)
+    error = numpy.sqrt(wf**2 * vf + wb**2 * vb)
+    return value, error, wf
+
+
+def figure_of_merit(n, weights, cost):
+    """Return the figure of merit, 1 / (sigma_rel^2 * cost), of a total."""
+    if (cost is None) or (cost <= 0.0):
+        return None
+    mean = numpy.sum(weights) / n
+    var = (numpy.sum(weights**2) / n - mean**2) / n
+    if var <= 0.0:
+        return None
+    return mean**2 / (var * cost)
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(
+        description="Combine forward and backward simulation data, per bin.")
+
+    parser.add_argument("-f",
+        dest="forward",
+        help="forward raw events files (see test.py --raw)",
+        nargs="+",
+        required=True)
+    parser.add_argument("-b",
+        dest="backward",
+        help="backward raw events files (see test-backward.py --raw)",
+        nargs="+",
+        required=True)
+    parser.add_argument("--forward-cost",
+        help="computing cost of the forward campaign (e.g. CPU hours)",
+        type=float)
+    parser.add_argument("--backward-cost",
+        help="computing cost of the backward campaign (e.g. CPU hours)",
+        type=float)
+    parser.add_argument("--energy-bins",
+        help="number of (log-spaced) energy bins, over 1E-02-3 MeV",
+        type=int,
+        default=300)
+    parser.add_argument("--cos-theta-bins",
+        help="number of cos(theta) bins",
+        type=int,
+        default=100)
+    parser.add_argument("--distance-bins",
+        help="number of (log-spaced) distance bins, over 1-1E+06 cm",
+        type=int,
+        default=120)
+    parser.add_argument("-o", "--output",
+        help="output file",
+        default="goupil.combined.pkl")
+
+    args = parser.parse_args()
+
+    binning = {
+        "energy": numpy.logspace(-2, numpy.log10(3.0), args.energy_bins + 1),
+        "cos_theta": numpy.linspace(-1.0, 1.0, args.cos_theta_bins + 1),
+        "distance": numpy.logspace(0.0, 6.0, args.distance_bins + 1),
+    }
+
+    forward = simulation.load_events(args.forward, "forward")
+    backward = simulation.load_events(args.backward, "backward")
+    sf = simulation.selections(forward)
+    sb = simulation.selections(backward)
+
+    # Per bin combination of the forward and backward estimates. Results
+    # are stored as edges and per bin value, error and forward weight.
+    data = {}
+    for tag in ("continuous", "discrete"):
+        wf = forward.expected["weight"][sf[tag]]
+        wb = backward.expected["weight"][sb[tag]]
+        if (wf.size == 0) and (wb.size == 0):
+            raise ValueError(f"{tag}: no events selected")
+        vf = simulation.variables(forward, sf[tag])
+        vb = simulation.variables(backward, sb[tag])
+
+        data[tag] = {}
+        for i, variable in enumerate(VARIABLES):
+            edges = binning[variable]
+            value, error, weight = combine(
+                histogram(forward.n_generated, vf[i], wf, edges),
+                histogram(backward.n_generated, vb[i], wb, edges))
+            data[tag][variable] = {
+                "edges": edges,
+                "value": value,
+                "error": error,
+                "w_forward": weight,
+            }
+
+        msg = f"{tag}: <w_forward> (energy) = " \
+              f"{numpy.mean(data[tag]['energy']['w_forward']):.3f}"
+        fom_f = figure_of_merit(forward.n_generated, wf, args.forward_cost)
+        fom_b = figure_of_merit(backward.n_generated, wb, args.backward_cost)
+        if (fom_f is not None) and (fom_b is not None):
+            # The precision of the combination is the sum of the precisions
+            # of both modes, i.e. FOM * cost. Thus, for a fixed budget, the
+            # mode with the highest FOM should be run.
+            best = "forward" if fom_f > fom_b else "backward"
+            msg += f", FOM = {fom_f:.3E} (forward) / {fom_b:.3E} (backward)" \
+                   f", best = {best}"
+        print(msg)
+
+    with open(args.output, "wb") as f:
+        pickle.dump(data, f)
@@ -0,0 +1,211 @@
+#! /usr/bin/env python3
+"""Persistent local simulation daemon.
+
+The daemon keeps the geometry, the sampling tables and the transport engines
+loaded, and serves batch jobs over a Unix domain socket. Requests are JSON
+encoded, e.g. {"mode": "backward", "events": 100000, "seed": 1, "alpha": 0.5},
+optionally with forward lines "bias" factors or backward energy "windows" (see
+simulation.Simulation), which only apply to the job itself. Results are streamed back, chunk by chunk, as pickled summaries. All
+messages are framed with an 8 bytes (little endian) length prefix.
+"""
+import argparse
+import json
+import os
+import pickle
+import socket
+import socketserver
+import struct
+
+import simulation
+
+
+SOCKET_PATH = "goupil.sock"
+
+
+def send(sock, payload):
+    sock.sendall(struct.pack("<Q", len(payload)) + payload)
+
+
+def receive(sock):
+    def read(n):
+        buf = bytearray()
+        while len(buf) < n:
+            b = sock.recv(n - len(buf))
+            if not b:
+                raise ConnectionError("connection closed")
+            buf += b
+        return bytes(buf)
+    n, = struct.unpack("<Q", read(8))
+    return read(n)
+
+
+class Handler(socketserver.BaseRequestHandler):
+    def handle(self):
+        sim = self.server.simulation
+        try:
+            job = json.loads(receive(self.request))
+            mode = job.get("mode", "backward")
+            events = int(job.get("events", 100000))
+            chunk = max(int(job.get("chunk", events)), 1)
+            alpha = float(job.get("alpha", 0.5))
+            if mode not in ("forward", "backward"):
+                raise ValueError(f"bad mode ({mode})")
+            if "seed" in job:
+                sim.seed(int(job["seed"]))
+            # The simulation state persists across jobs. Thus, biasing options
+            # are (re)set for each job.
+            sim.bias(job.get("bias", None))
+            sim.windows(job.get("windows", None))
+
+            done = 0
+            while done < events:
+                n = min(chunk, events - done)
+                data = simulation.summarise(sim.run(mode, n, alpha))
+                done += n
+                send(self.request, pickle.dumps({"events": n, "data": data}))
+            send(self.request, pickle.dumps({"done": True}))
+        except Exception as e:
+            try:
+                send(self.request, pickle.dumps({"error": str(e)}))
+            except OSError:
+                pass
+        finally:
+            sim.bias(None)
+            sim.windows(None)
+
+
+class Server(socketserver.UnixStreamServer):
+    def __init__(self, path, lib_path):
+        # Refuse to replace the socket of a running daemon.
+        if os.path.exists(path):
+            with socket.socket(socket.AF_UNIX, socket.SOCK_STREAM) as sock:
+                try:
+                    sock.connect(path)
+                except OSError:
+                    pass # stale socket
+                else:
+                    raise RuntimeError(f"{path}: daemon already running")
+
+        # Warm up the simulation, including cross-sections tables.
+        self.simulation = simulation.Simulation(lib_path)
+        for mode in ("forward", "backward"):
+            self.simulation.run(mode, 1)
+
+        if os.path.exists(path):
+            os.remove(path)
+        # Restrict access to the owner from the socket creation on, since
+        # pickles are exchanged.
+        umask = os.umask(0o177)
+        try:
+            super().__init__(path, Handler)
+        finally:
+            os.umask(umask)
+
+
+def submit(path, job):
+    """Submit a job to the daemon and return the merged results."""
+    with socket.socket(socket.AF_UNIX, socket.SOCK_STREAM) as sock:
+        sock.connect(path)
+        send(sock, json.dumps(job).encode())
+        data = None
+        while True:
+            msg = pickle.loads(receive(sock))
+            if "error" in msg:
+                raise RuntimeError(msg["error"])
+            elif msg.get("done", False):
+                return data
+            data = simulation.merge(data, msg["data"])
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(
+        description="Persistent local Geant4-Goupil simulation daemon."
+    )
+    parser.add_argument("-S", "--socket",
+        help = "socket path",
+        default = SOCKET_PATH
+    )
+    subparsers = parser.add_subparsers(dest="command", required=True)
+
+    serve = subparsers.add_parser("serve",
+        help = "run the daemon"
+    )
+    serve.add_argument("-l", "--library",
+        help = "geometry library",
+        default = simulation.LIB_PATH
+    )
+
+    client = subparsers.add_parser("submit",
+        help = "submit a job to the daemon"
+    )
+    client.add_argument("-m", "--mode",
+        help = "transport mode",
+        choices = ("forward", "backward"),
+        default = "backward"
+    )
+    client.add_argument("-e", "--events",
+        help = "number of events to generate",
+        type = int,
+        default = 100000
+    )
+    client.add_argument("-c", "--chunk",
+        help = "number of events per streamed chunk",
+        type = int,
+        default = None
+    )
+    client.add_argument("-s", "--seed",
+        help = "random seed",
+        type = int,
+        default = None
+    )
+    client.add_argument("-a", "--alpha",
+        help = "backward biasing parameter",
+        type = float,
+        default = 0.5
+    )
+    client.add_argument("-b", "--bias",
+        help = "forward lines bias factors (see run-parallel.py)",
+        type = float,
+        nargs = "+",
+        default = None
+    )
+    client.add_argument("-w", "--window",
+        help = "restrict backward energies to an analysis window (MeV), "
+               "can be repeated",
+        type = float,
+        nargs = 2,
+        action = "append",
+        metavar = ("EMIN", "EMAX")
+    )
+    client.add_argument("-o", "--output",
+        help = "output file",
+        default = None
+    )
+
+    args = parser.parse_args()
+
+    if args.command == "serve":
+        with Server(args.socket, args.library) as server:
+            try:
+                server.serve_forever()
+            finally:
+                os.remove(args.socket)
+    else:
+        job = { "mode": args.mode, "events": args.events, "alpha": args.alpha }
+        if args.chunk is not None:
+            job["chunk"] = args.chunk
+        if args.seed is not None:
+            job["seed"] = args.seed
+        if args.bias is not None:
+            job["bias"] = args.bias
+        if args.window:
+            job["windows"] = args.window
+        data = submit(args.socket, job)
+        tag = ""
+        if args.window:
+            # Tag windowed results (see run-parallel.py).
+            data["windows"] = sorted(tuple(window) for window in args.window)
+            tag = ".windowed"
+        output = args.output or f"goupil.{args.mode}{tag}.pkl"
+        with open(output, "wb") as f:
+            pickle.dump(data, f)
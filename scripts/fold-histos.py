@@ -0,0 +1,150 @@
+#!/usr/bin/env python3
+import argparse
+import ctypes
+import numpy
+import os
+
+import tally
+
+
+class Response:
+    """Detector response (see include/Folding.hh)."""
+
+    def __init__(self, lib, edges, noise, stochastic, constant,
+                 efficiency=None, density=False):
+        self.lib = lib
+        self.size = edges.size - 1
+        edges = numpy.ascontiguousarray(edges, dtype=float)
+        pointer = None
+        if efficiency is not None:
+            efficiency = numpy.ascontiguousarray(efficiency, dtype=float)
+            pointer = efficiency.ctypes.data
+        self._response = lib.folding_response_new(self.size, edges.ctypes.data,
+            noise, stochastic, constant, pointer, int(density))
+
+    def __del__(self):
+        self.lib.folding_response_destroy(self._response)
+
+    def fold(self, values, squared=False, threads=0):
+        """Fold a batch of histograms, of shape (n, size)."""
+        values = numpy.ascontiguousarray(values, dtype=float)
+        result = numpy.empty(values.shape)
+        n = values.size // self.size
+        self.lib.folding_response_apply(self._response, n, values.ctypes.data,
+            result.ctypes.data, int(squared), threads)
+        return result
+
+
+def load_library(path):
+    lib = ctypes.CDLL(path)
+    lib.folding_response_new.argtypes = [ctypes.c_size_t, ctypes.c_void_p,
+        ctypes.c_double, ctypes.c_double, ctypes.c_double, ctypes.c_void_p,
+        ctypes.c_int]
+    lib.folding_response_new.restype = ctypes.c_void_p
+    lib.folding_response_destroy.argtypes = [ctypes.c_void_p]
+    lib.folding_response_destroy.restype = None
+    lib.folding_response_apply.argtypes = [ctypes.c_void_p, ctypes.c_size_t,
+        ctypes.c_void_p, ctypes.c_void_p, ctypes.c_int, ctypes.c_int]
+    lib.folding_response_apply.restype = None
+    return lib
+
+
+def load(path, edges):
+    """Return the binning and per event mean and error of an energy tally.
+
+    Inputs are either tally stores (see tally.py) or raw events files (see
+    simulation.save_events), which are histogrammed with the given edges.
+    """
+    if os.path.isdir(path):
+        store = tally.TallyStore(path)
+        mean, err = store.result()
+        return store.edges, mean, err
+    else:
+        # Raw events are loaded through the simulation module, which requires
+        # goupil. Thus, it is only imported when needed.
+        import simulation
+        events = simulation.load_events((path,), None)
+        weights = events.expected["weight"]
+        energies = events.expected["energy"]
+        n = events.n_generated
+        s0, _ = numpy.histogram(energies, edges, weights=weights)
+        s1, _ = numpy.histogram(energies, edges, weights=weights**2)
+        mean = s0 / n
+        err = numpy.sqrt(numpy.maximum(s1 / n - mean**2, 0.0) / n)
+        return edges, mean, err
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(
+        description="Fold energy tallies with the detector resolution.")
+
+    parser.add_argument("inputs",
+        help="tally stores or raw events files",
+        nargs="+")
+    parser.add_argument("-n", "--noise",
+        help="noise term of the resolution (MeV)",
+        type=float,
+        default=0.0)
+    parser.add_argument("-s", "--stochastic",
+        help="stochastic term of the resolution (MeV^1/2)",
+        type=float,
+        default=0.0)
+    parser.add_argument("-c", "--constant",
+        help="constant term of the resolution",
+        type=float,
+        default=0.0)
+    parser.add_argument("-e", "--efficiency",
+        help="efficiency table (text file of energy, efficiency)")
+    parser.add_argument("-b", "--bins",
+        help="number of (log-spaced) bins, for raw events",
+        type=int,
+        default=300)
+    parser.add_argument("--range",
+        help="energy range (MeV), for raw events",
+        type=float,
+        nargs=2,
+        default=(1E-02, 3.0))
+    parser.add_argument("-j", "--jobs",
+        help="number of threads",
+        type=int,
+        default=0)
+    parser.add_argument("-l", "--library",
+        help="folding library",
+        default="lib/libfolding.so")
+
+    args = parser.parse_args()
+
+    lib = load_library(args.library)
+    if args.efficiency is not None:
+        table = numpy.loadtxt(args.efficiency)
+    default_edges = numpy.logspace(numpy.log10(args.range[0]),
+        numpy.log10(args.range[1]), args.bins + 1)
+
+    # Collect tallies, grouped by binning, such that they are folded in
+    # batches.
+    batches = {}
+    for path in args.inputs:
+        edges, mean, err = load(path, default_edges)
+        if not numpy.any(mean):
+            raise ValueError(f"{path}: empty tally")
+        key = edges.tobytes()
+        batches.setdefault(key, (edges, []))[1].append((path, mean, err))
+    if not batches:
+        raise ValueError("no tally to fold")
+
+    for edges, entries in batches.values():
+        efficiency = None
+        if args.efficiency is not None:
+            centers = 0.5 * (edges[1:] + edges[:-1])
+            efficiency = numpy.interp(centers, table[:,0], table[:,1])
+        # Tallies are per bin (not densities).
+        response = Response(lib, edges, args.noise, args.stochastic,
+                            args.constant, efficiency)
+        values = numpy.array([mean for _, mean, _ in entries])
+        errors = numpy.array([err for _, _, err in entries])
+        values = response.fold(values, threads=args.jobs)
+        errors = numpy.sqrt(response.fold(errors**2, squared=True,
+                                          threads=args.jobs))
+        for (path, _, _), x, s in zip(entries, values, errors):
+            root, _ = os.path.splitext(path.rstrip(os.sep))
+            numpy.savez(f"{root}.folded.npz", edges=edges, value=x, error=s)
@@ -25,6 +25,12 @@ if __name__ == "__main__":
             d = pickle.load(f)
         all_data.append(d)
 
+    # Windowed results (see run-parallel.py) only cover part of the spectrum.
+    windows = all_data[0].get("windows", None)
+    for file, d in zip(args.files, all_data):
+        if d.get("windows", None) != windows:
+            raise ValueError(f"{file}: inconsistent energy windows")
+
     continuous = DataSummary.sum([d["continuous"] for d in all_data])
     discrete = DataSummary.sum([d["discrete"] for d in all_data])
     if forward:
@@ -41,5 +47,8 @@ if __name__ == "__main__":
         }
 
     tag = "forward" if forward else "backward"
+    if windows is not None:
+        data["windows"] = windows
+        tag += ".windowed"
     with open(f"goupil.{tag}.pkl", "wb") as f:
         pickle.dump(data, f)
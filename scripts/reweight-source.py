@@ -0,0 +1,58 @@
+#!/usr/bin/env python3
+import argparse
+import numpy
+import pickle
+
+import simulation
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(
+        description="Reweight simulation data for exponential source densities.")
+
+    parser.add_argument("-f",
+        dest="files",
+        help="raw events files (see test.py --raw)",
+        nargs="+")
+    parser.add_argument("-s", "--scale-heights",
+        help="scale heights of the source density, in m (inf for uniform)",
+        type=float,
+        nargs="+",
+        default=[numpy.inf])
+    parser.add_argument("-l", "--library",
+        help="geometry library",
+        default=simulation.LIB_PATH)
+    parser.add_argument("-o", "--output",
+        help="output file",
+        default=None)
+
+    args = parser.parse_args()
+
+    sim = simulation.Simulation(args.library)
+    mode = "forward" if args.files[0].endswith(".forward.pkl") else "backward"
+
+    # Inverse scale heights, in 1 / cm.
+    heights = numpy.array(args.scale_heights)
+    lambdas = 1.0 / (heights * 1E+02)
+
+    results = [None] * lambdas.size
+    for file in args.files:
+        print(f"processing {file}")
+        events = simulation.load_events((file,), mode)
+
+        # Likelihood ratios, for all scale heights at once. Raw events are
+        # weighted in both modes (e.g. biased forward lines).
+        ratios = sim.reweight(events.primaries, lambdas)
+        ratios *= events.expected["weight"]
+
+        results = [
+            simulation.merge(result, simulation.summarise(events, weights))
+            for result, weights in zip(results, ratios)
+        ]
+
+    data = { h: d for h, d in zip(args.scale_heights, results) }
+
+    if args.output is None:
+        args.output = f"goupil.{mode}.reweighted.pkl"
+    with open(args.output, "wb") as f:
+        pickle.dump(data, f)
@@ -0,0 +1,212 @@
+#! /usr/bin/env python3
+import argparse
+import json
+import multiprocessing
+import numpy
+import os
+import pickle
+import sys
+import time
+
+import simulation
+import tally
+
+
+# Per worker simulation, loaded once by the pool initializer.
+SIMULATION = None
+TALLY = None
+
+
+def initialise(lib_path, tally_path, bias=None, windows=None):
+    global SIMULATION, TALLY
+    SIMULATION = simulation.Simulation(lib_path)
+    if bias is not None:
+        SIMULATION.bias(bias)
+    if windows is not None:
+        SIMULATION.windows(windows)
+    if tally_path is not None:
+        TALLY = tally.TallyStore(tally_path)
+
+
+def process(task):
+    """Simulate a chunk of events, identified by its index."""
+    index, seed, mode, events, alpha = task
+    SIMULATION.seed(seed)
+    data = SIMULATION.run(mode, events, alpha)
+    if TALLY is not None:
+        s = data.expected[data.valid]
+        weights = s["weight"] if data.weighted else None
+        TALLY.fill(s["energy"], weights, data.n_generated)
+    return index, simulation.summarise(data)
+
+
+def pilot(events):
+    """Estimate lines detection probabilities from a forward pilot run."""
+    return SIMULATION.detection_probabilities(events)
+
+
+def dump(data, path):
+    tmp = f"{path}.tmp"
+    with open(tmp, "wb") as f:
+        pickle.dump(data, f)
+    os.replace(tmp, path)
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(
+        description="Geant4-Goupil simulations over a pool of local processes."
+    )
+    parser.add_argument("-m", "--mode",
+        help = "transport mode",
+        choices = ("forward", "backward"),
+        default = "backward"
+    )
+    parser.add_argument("-e", "--events",
+        help = "total number of events to generate",
+        type = int,
+        default = 10000000
+    )
+    parser.add_argument("-c", "--chunk",
+        help = "number of events per chunk",
+        type = int,
+        default = 100000
+    )
+    parser.add_argument("-j", "--jobs",
+        help = "number of worker processes",
+        type = int,
+        default = os.cpu_count()
+    )
+    parser.add_argument("-s", "--seed",
+        help = "base seed, from which chunk seeds are spawned",
+        type = int,
+        default = None
+    )
+    parser.add_argument("-a", "--alpha",
+        help = "backward biasing parameter",
+        type = float,
+        default = 0.5
+    )
+    parser.add_argument("-b", "--line-bias",
+        help = "bias forward lines by their detection probability, estimated "
+               "from a pilot run of the given number of events",
+        type = int,
+        default = 0
+    )
+    parser.add_argument("-w", "--window",
+        help = "restrict backward energies to an analysis window (MeV), "
+               "can be repeated",
+        type = float,
+        nargs = 2,
+        action = "append",
+        metavar = ("EMIN", "EMAX")
+    )
+    parser.add_argument("--checkpoint",
+        help = "dump merged results every given number of chunks "
+               "(0: only at the end)",
+        type = int,
+        default = 10
+    )
+    parser.add_argument("-t", "--tally",
+        help = "shared energy tally store (see tally.py)",
+        default = None
+    )
+    parser.add_argument("--tally-bins",
+        help = "number of (log-spaced) bins of the energy tally "
+               "(per window, if any)",
+        type = int,
+        default = 300
+    )
+    parser.add_argument("-l", "--library",
+        help = "geometry library",
+        default = simulation.LIB_PATH
+    )
+    parser.add_argument("-o", "--output",
+        help = "output file",
+        default = None
+    )
+
+    parser.add_argument("--config",
+        help = "configuration file, providing default options "
+               "(see auto-configure.py)",
+        default = None
+    )
+
+    args = parser.parse_args()
+
+    if args.config is not None:
+        # Options explicitly set on the command line take precedence.
+        with open(args.config) as f:
+            config = json.load(f)
+        options = { k: v for k, v in config.items() if hasattr(args, k) }
+        parser.set_defaults(**options)
+        args = parser.parse_args()
+
+    if args.chunk <= 0:
+        parser.error("chunk size must be positive")
+    if args.checkpoint < 0:
+        parser.error("checkpoint must be positive or null")
+
+    if args.seed is None:
+        args.seed = int.from_bytes(os.urandom(4), "little")
+    # Windowed results only cover part of the spectrum. They are tagged as
+    # such, in order not to be merged with full range results.
+    windows = None
+    if args.window:
+        windows = sorted(tuple(window) for window in args.window)
+    if args.output is None:
+        tag = "" if windows is None else ".windowed"
+        args.output = f"goupil.{args.mode}{tag}.pkl"
+
+    # Split the campaign in chunks. Chunks are pulled from a shared queue by
+    # idle workers, such that all workers remain busy until the end, whatever
+    # the cost of individual chunks.
+    # Chunk seeds are spawned from the base seed, such that campaigns with
+    # different base seeds use independent streams.
+    n_chunks = (args.events + args.chunk - 1) // args.chunk
+    seeds = [int(s.generate_state(1, numpy.uint64)[0]) for s in
+             numpy.random.SeedSequence(args.seed).spawn(n_chunks)]
+    tasks = []
+    remaining = args.events
+    for index, seed in enumerate(seeds):
+        n = min(args.chunk, remaining)
+        tasks.append((index, seed, args.mode, n, args.alpha))
+        remaining -= n
+
+    if args.tally is not None:
+        # Create the store, if not already existing. Several campaigns might
+        # accumulate into the same store, concurrently, provided that they
+        # use the same binning (which is checked). Each worker gets its own
+        # shard.
+        if args.window:
+            edges = simulation.window_edges(args.window, args.tally_bins)
+        else:
+            edges = numpy.logspace(-2, numpy.log10(3.0), args.tally_bins + 1)
+        tally.TallyStore(args.tally, edges)
+
+    context = multiprocessing.get_context("spawn")
+    bias = None
+    if (args.mode == "forward") and (args.line_bias > 0):
+        with context.Pool(1, initialise, (args.library, None)) as pool:
+            bias = pool.apply(pilot, (args.line_bias,))
+        print(f"lines bias: {bias}")
+
+    print(f"running {len(tasks)} chunks over {args.jobs} workers "
+          f"(seed = {args.seed})")
+
+    t0 = time.time()
+    data = None
+    with context.Pool(args.jobs, initialise,
+                      (args.library, args.tally, bias, args.window)) as pool:
+        for done, (index, result) in enumerate(
+                pool.imap_unordered(process, tasks, chunksize=1), 1):
+            data = simulation.merge(data, result)
+            if windows is not None:
+                data["windows"] = windows
+            if ((args.checkpoint > 0) and (done % args.checkpoint == 0)) or \
+               (done == len(tasks)):
+                dump(data, args.output)
+            elapsed = time.time() - t0
+            sys.stdout.write(f"\rprocessed {done} / {len(tasks)} chunks "
+                             f"({elapsed:.0f} s)")
+            sys.stdout.flush()
+    sys.stdout.write("\n")
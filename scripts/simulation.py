@@ -0,0 +1,297 @@
+"""Geant4-Goupil simulations, wrapped as a reusable object.
+
+The geometry library and the transport engines are loaded once, when the
+Simulation object is created. Batches of events can then be generated
+repeatedly, e.g. by a pool of worker processes.
+"""
+import ctypes
+import goupil
+import numpy
+import pickle
+
+
+LIB_PATH = "lib/libgeometry.so"
+
+
+class Events:
+    """Raw simulation results."""
+
+    def __init__(self, mode, n_generated, primaries, expected, valid, weighted):
+        self.mode = mode
+        self.n_generated = n_generated
+        self.primaries = primaries
+        self.expected = expected
+        self.valid = valid
+        self.weighted = weighted
+
+
+class Simulation:
+    def __init__(self, lib_path=LIB_PATH):
+        # Load shared library.
+        self.clib = clib = ctypes.CDLL(lib_path)
+
+        # Prototype library functions.
+        clib.g4randomize_seed.argtypes = [ctypes.c_ulong]
+        clib.g4randomize_seed.restype = None
+
+        clib.g4randomize_states.argtypes = [ctypes.c_size_t, ctypes.c_void_p]
+        clib.g4randomize_states.restype = None
+
+        clib.g4randomize_backward.argtypes = [ctypes.c_double, ctypes.c_size_t,
+                                              ctypes.c_void_p, ctypes.c_void_p]
+        clib.g4randomize_backward.restype = None
+
+        clib.g4randomize_source_volume.argtypes = []
+        clib.g4randomize_source_volume.restype = ctypes.c_double
+
+        clib.g4randomize_bias.argtypes = [ctypes.c_size_t, ctypes.c_void_p]
+        clib.g4randomize_bias.restype = ctypes.c_int
+
+        clib.g4randomize_lines.argtypes = [ctypes.c_void_p, ctypes.c_void_p]
+        clib.g4randomize_lines.restype = ctypes.c_size_t
+
+        clib.g4randomize_windows.argtypes = [ctypes.c_size_t, ctypes.c_void_p]
+        clib.g4randomize_windows.restype = ctypes.c_int
+
+        clib.g4reweight_exponential.argtypes = [ctypes.c_size_t,
+            ctypes.c_void_p, ctypes.c_size_t, ctypes.c_void_p, ctypes.c_void_p]
+        clib.g4reweight_exponential.restype = None
+
+        # Load geometry.
+        self.geometry = goupil.ExternalGeometry(lib_path)
+        self.source_volume = clib.g4randomize_source_volume()
+        self._engines = {}
+        self._seed = None
+        self.biased = False
+
+    def engine(self, mode):
+        """Return the transport engine for the given mode."""
+        try:
+            return self._engines[mode]
+        except KeyError:
+            engine = goupil.TransportEngine(self.geometry)
+            if mode == "backward":
+                engine.mode = "Backward"
+            engine.boundary = 2 # Termination when sector with index 2 is entered.
+            if self._seed is not None:
+                engine.random.seed = self._seed
+            self._engines[mode] = engine
+            return engine
+
+    def seed(self, seed):
+        """Seed the random streams used for sampling primaries and for their
+        transport."""
+        self.clib.g4randomize_seed(seed)
+        self._seed = seed
+        for engine in self._engines.values():
+            engine.random.seed = seed
+
+    def forward(self, n):
+        """Transport n events in forward mode."""
+        states = goupil.states(n)
+        self.clib.g4randomize_states(states.size, states.ctypes.data)
+
+        primaries = states.copy()
+        status = self.engine("forward").transport(states)
+        valid = status == goupil.TransportStatus.BOUNDARY
+
+        return Events("forward", n, primaries, states, valid, self.biased)
+
+    def backward(self, n, alpha=0.5):
+        """Transport n events in backward mode."""
+        states = goupil.states(n)
+        sources_energies = numpy.empty(states.size)
+        self.clib.g4randomize_backward(
+            alpha, states.size, states.ctypes.data, sources_energies.ctypes.data)
+
+        expected = states.copy()
+        status = self.engine("backward").transport(states, sources_energies)
+
+        expected["weight"] = states["weight"]
+        primaries = states
+
+        sectors = self.geometry.locate(primaries)
+        valid = (status == goupil.TransportStatus.ENERGY_CONSTRAINT) & (sectors == 1)
+        expected["weight"][valid] /= self.source_volume * 4.0 * numpy.pi
+
+        return Events("backward", n, primaries, expected, valid, True)
+
+    def lines(self):
+        """Return the energies and intensities of emission lines."""
+        n = self.clib.g4randomize_lines(None, None)
+        energies, intensities = numpy.empty(n), numpy.empty(n)
+        self.clib.g4randomize_lines(energies.ctypes.data,
+                                    intensities.ctypes.data)
+        return energies, intensities
+
+    def bias(self, factors=None):
+        """Bias the forward sampling of lines (None disables the biasing).
+
+        Lines are sampled in proportion to their intensity times the given
+        factor, and forward events are weighted accordingly.
+        """
+        if factors is None:
+            self.clib.g4randomize_bias(0, None)
+            self.biased = False
+        else:
+            factors = numpy.ascontiguousarray(factors, dtype=float)
+            energies, _ = self.lines()
+            if factors.size != energies.size:
+                raise ValueError(f"expected {energies.size} bias factors, "
+                                 f"got {factors.size}")
+            if numpy.any(factors <= 0.0):
+                raise ValueError("bias factors must be positive")
+            self.biased = False
+            if self.clib.g4randomize_bias(factors.size,
+                                          factors.ctypes.data) != 0:
+                raise ValueError("bad bias factors")
+            self.biased = True
+
+    def detection_probabilities(self, n):
+        """Estimate the detection probability of each line from an unbiased
+        forward pilot run of n events.
+
+        Lines that were not detected during the pilot run are given the
+        smallest observed probability, such that they are still sampled.
+        """
+        if self.biased:
+            raise RuntimeError("pilot runs must be unbiased")
+        events = self.forward(n)
+        energies, _ = self.lines()
+        emitted = events.primaries["energy"]
+        probabilities = numpy.zeros(energies.size)
+        for i, energy in enumerate(energies):
+            sel = emitted == energy
+            if numpy.any(sel):
+                probabilities[i] = numpy.mean(events.valid[sel])
+        positive = probabilities > 0.0
+        floor = numpy.min(probabilities[positive]) if numpy.any(positive) else 1.0
+        return numpy.where(positive, probabilities, floor)
+
+    def windows(self, windows=None):
+        """Restrict backward energies to analysis windows, given as (min, max)
+        pairs in MeV (None removes the restriction)."""
+        if windows is None:
+            self.clib.g4randomize_windows(0, None)
+        else:
+            windows = numpy.ascontiguousarray(windows, dtype=float)
+            if self.clib.g4randomize_windows(windows.size // 2,
+                                             windows.ctypes.data) != 0:
+                raise ValueError("no source line contributes to windows")
+
+    def reweight(self, primaries, lambdas):
+        """Return the likelihood ratios of exponential source densities, of
+        inverse scale heights lambdas (in 1 / cm), w.r.t. the uniform one."""
+        primaries = numpy.ascontiguousarray(primaries)
+        lambdas = numpy.ascontiguousarray(lambdas, dtype=float)
+        ratios = numpy.empty((lambdas.size, primaries.size))
+        self.clib.g4reweight_exponential(lambdas.size, lambdas.ctypes.data,
+            primaries.size, primaries.ctypes.data, ratios.ctypes.data)
+        return ratios
+
+    def run(self, mode, n, alpha=0.5):
+        """Transport n events and return the corresponding raw results."""
+        if mode == "forward":
+            return self.forward(n)
+        else:
+            return self.backward(n, alpha)
+
+
+def window_edges(windows, bins):
+    """Return tally edges matching analysis windows.
+
+    Each window is split in the given number of log-spaced bins. Gaps between
+    windows are covered by a single (empty) bin.
+    """
+    edges = []
+    for emin, emax in sorted(windows):
+        e = numpy.logspace(numpy.log10(emin), numpy.log10(emax), bins + 1)
+        if edges and (e[0] <= edges[-1]):
+            e = e[e > edges[-1]]
+        edges += list(e)
+    return numpy.array(edges)
+
+
+def selections(events):
+    """Return the selections of scattered (continuous) and unscattered
+    (discrete) events."""
+    states, primaries = events.expected, events.primaries
+    return {
+        "continuous": events.valid & (states["energy"] < primaries["energy"]),
+        "discrete": events.valid & (states["energy"] == primaries["energy"]),
+    }
+
+
+def variables(events, sel):
+    """Return the histogrammed variables (energy, cos_theta, distance) of
+    selected events."""
+    s, p = events.expected[sel], events.primaries[sel]
+    cos_theta = numpy.sum(s["direction"] * p["direction"], axis=1)
+    distances = numpy.linalg.norm(s["position"] - p["position"], axis=1)
+    return s["energy"], cos_theta, distances
+
+
+def summarise(events, weights=None):
+    """Histogram simulation results, as done by test*.py scripts.
+
+    Events weights can be overridden by providing an array of weights (for
+    all events).
+    """
+    from goupil_analysis import DataSummary, Histogramed
+
+    if (weights is None) and events.weighted:
+        weights = events.expected["weight"]
+
+    data = {}
+    for tag, sel in selections(events).items():
+        energies, cos_theta, distances = variables(events, sel)
+        w = None if weights is None else weights[sel]
+        data[tag] = DataSummary.new(events.n_generated, energies, cos_theta,
+                                    distances, w, discrete=(tag == "discrete"))
+
+    if events.mode == "backward":
+        sel = selections(events)["continuous"]
+        data["energy_thin"] = Histogramed.energy_thin(
+            events.n_generated, events.expected["energy"][sel], weights[sel])
+
+    return data
+
+
+def save_events(events, path):
+    """Save selected raw events, in the format read by build-histo.py."""
+    data = {
+        "n_generated": events.n_generated,
+        "expected": events.expected[events.valid],
+        "primaries": events.primaries[events.valid],
+    }
+    with open(path, "wb") as f:
+        pickle.dump(data, f)
+
+
+def load_events(paths, mode):
+    """Load and concatenate raw events saved by save_events."""
+    n, expected, primaries = 0, [], []
+    for path in paths:
+        with open(path, "rb") as f:
+            d = pickle.load(f)
+        n += d["n_generated"]
+        expected.append(d["expected"])
+        primaries.append(d["primaries"])
+    expected = numpy.concatenate(expected)
+    primaries = numpy.concatenate(primaries)
+    valid = numpy.ones(expected.size, dtype=bool)
+    return Events(mode, n, primaries, expected, valid, True)
+
+
+def merge(a, b):
+    """Merge two histogrammed results."""
+    if a is None:
+        return b
+    from goupil_analysis import DataSummary, Histogramed
+
+    data = {}
+    for tag in ("continuous", "discrete"):
+        data[tag] = DataSummary.sum([a[tag], b[tag]])
+    if "energy_thin" in a:
+        data["energy_thin"] = Histogramed.sum([a["energy_thin"], b["energy_thin"]])
+    return data
@@ -0,0 +1,136 @@
+"""Histogram tallies shared between local processes.
+
+A tally store is a directory holding memory-mapped arrays, with one shard
+per writer process. A process claims a shard (using a file lock) on its
+first fill, creating a new shard if all existing ones are in use, and then
+accumulates sums of weights and of squared weights in its own shard without
+any further synchronisation. Readers sum all shards, such that results are
+available live, while processes are running.
+
+Layout of a store:
+  edges.npy             bin edges, of size n + 1;
+  shard.<i>.sums.npy    sums of weights and of squared weights, shape (2, n);
+  shard.<i>.events.npy  number of generated events;
+  shard.<i>.lock        lock file.
+"""
+import fcntl
+import glob
+import numpy
+import os
+import tempfile
+
+
+class TallyStore:
+    def __init__(self, path, edges=None):
+        """Open the store at path, creating it if edges are provided.
+
+        If the store already exists, the provided edges must match the
+        stored ones.
+        """
+        self.path = path
+        if not os.path.exists(path):
+            if edges is None:
+                raise FileNotFoundError(path)
+            self._create(edges)
+
+        self.edges = numpy.load(os.path.join(path, "edges.npy"))
+        if (edges is not None) and \
+           not numpy.array_equal(self.edges, numpy.asarray(edges, dtype=float)):
+            raise ValueError(f"{path}: inconsistent binning")
+        self.shard = None
+        self._lock = None
+        self._sums = None
+        self._events = None
+
+    def _create(self, edges):
+        # The store is built in a temporary directory and then atomically
+        # renamed, since several processes might attempt to create it.
+        parent = os.path.dirname(os.path.abspath(self.path))
+        tmp = tempfile.mkdtemp(dir=parent)
+        edges = numpy.asarray(edges, dtype=float)
+        numpy.save(os.path.join(tmp, "edges.npy"), edges)
+        try:
+            os.rename(tmp, self.path)
+        except OSError:
+            # Created meanwhile by another process.
+            os.remove(os.path.join(tmp, "edges.npy"))
+            os.rmdir(tmp)
+
+    def _shard_path(self, shard, name):
+        return os.path.join(self.path, f"shard.{shard}.{name}")
+
+    def _claim(self):
+        """Claim a free shard for this process, creating one if needed."""
+        shard = 0
+        while True:
+            path = self._shard_path(shard, "lock")
+            fd = os.open(path, os.O_RDWR | os.O_CREAT, 0o644)
+            try:
+                fcntl.flock(fd, fcntl.LOCK_EX | fcntl.LOCK_NB)
+            except BlockingIOError:
+                os.close(fd)
+                shard += 1
+                continue
+            break
+        self.shard, self._lock = shard, fd
+
+        sums_path = self._shard_path(shard, "sums.npy")
+        events_path = self._shard_path(shard, "events.npy")
+        if not os.path.exists(sums_path):
+            # New shard. Arrays are renamed once initialised, the sums last
+            # since readers locate shards from them.
+            for path, shape, dtype in (
+                    (events_path, (1,), numpy.int64),
+                    (sums_path, (2, self.edges.size - 1), float)):
+                tmp = f"{path}.tmp"
+                a = numpy.lib.format.open_memmap(tmp, mode="w+", dtype=dtype,
+                                                 shape=shape)
+                a[:] = 0
+                a.flush()
+                del a
+                os.replace(tmp, path)
+        self._events = numpy.load(events_path, mmap_mode="r+")
+        self._sums = numpy.load(sums_path, mmap_mode="r+")
+
+    def fill(self, values, weights=None, n_generated=0):
+        """Accumulate values (with optional weights) and generated events."""
+        if self.shard is None:
+            self._claim()
+        if weights is None:
+            weights = numpy.ones(numpy.size(values))
+        s0, _ = numpy.histogram(values, self.edges, weights=weights)
+        s1, _ = numpy.histogram(values, self.edges, weights=weights**2)
+        self._sums[0, :] += s0
+        self._sums[1, :] += s1
+        self._events[0] += n_generated
+
+    def result(self):
+        """Return the per event mean and its standard error, per bin."""
+        n = 0
+        s = numpy.zeros((2, self.edges.size - 1))
+        for path in glob.glob(self._shard_path("*", "sums.npy")):
+            s += numpy.load(path, mmap_mode="r")
+            n += numpy.load(path.replace(".sums.", ".events."),
+                            mmap_mode="r")[0]
+        if n == 0:
+            zero = numpy.zeros(self.edges.size - 1)
+            return zero, zero
+        mean = s[0] / n
+        err = numpy.sqrt(numpy.maximum(s[1] / n - mean**2, 0.0) / n)
+        return mean, err
+
+    def close(self):
+        """Flush this process's shard and release it."""
+        if self._lock is not None:
+            self._sums.flush()
+            self._events.flush()
+            self._sums, self._events = None, None
+            fcntl.flock(self._lock, fcntl.LOCK_UN)
+            os.close(self._lock)
+            self.shard, self._lock = None, None
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *args):
+        self.close()
@@ -1,70 +1,23 @@
 #! /usr/bin/env python3
-import ctypes
-import goupil
-import numpy
+import argparse
 import pickle
 
-# Lib path
-lib_path = "lib/libgeometry.so"
-
-# Load shared library.
-clib = ctypes.CDLL(lib_path)
-
-# Load geometry
-geometry = goupil.ExternalGeometry(lib_path)
-
-# Define & configure the engine transport
-engine = goupil.TransportEngine(geometry)
-engine.mode = "Backward"
-engine.boundary = 2 # Termination when sector with index 2 is entered. 
-
-states = goupil.states(10000000)
-sources_energies = numpy.empty(states.size)
-
-# Prototype library functions.
-clib.g4randomize_backward.argtypes = [ctypes.c_double, ctypes.c_size_t,
-                                      ctypes.c_void_p, ctypes.c_void_p]
-clib.g4randomize_backward.restype = None
-
-clib.g4randomize_source_volume.argtypes = []
-clib.g4randomize_source_volume.restype = ctypes.c_double
-
-clib.g4randomize_backward(
-    0.5, states.size, states.ctypes.data, sources_energies.ctypes.data)
-
-expected = states.copy()
-status = engine.transport(states, sources_energies)
-
-from goupil_analysis import DataSummary, Histogramed
-
-expected["weight"] = states["weight"]
-primaries = states
-states = expected
-
-sectors = geometry.locate(primaries)
-valid = (status == goupil.TransportStatus.ENERGY_CONSTRAINT) & (sectors == 1)
-states["weight"][valid] /= clib.g4randomize_source_volume() * 4.0 * numpy.pi
-
-sel0 = valid & (states["energy"] < primaries["energy"])
-sel1 = valid & (states["energy"] == primaries["energy"])
-
-data = {}
-for i, sel in enumerate((sel0, sel1)):
-    s, p = states[sel], primaries[sel]
-    energies = s["energy"]
-    cos_theta = numpy.sum(s["direction"] * p["direction"], axis=1)
-    distances = numpy.linalg.norm(s["position"] - p["position"], axis=1)
-    if i == 0:
-        tag = "continuous"
-        discrete = False
-    else:
-        tag = "discrete"
-        discrete = True
-    data[tag] = DataSummary.new(states.size, energies, cos_theta, distances,
-                                s["weight"], discrete=discrete)
-
-s = states[sel0]
-data["energy_thin"] = Histogramed.energy_thin(states.size, s["energy"], s["weight"])
+import simulation
+
+parser = argparse.ArgumentParser(
+    description="Geant4-Goupil simulations in a backward mode."
+)
+parser.add_argument("-r", "--raw",
+    help = "output file for raw events (see combine-histos.py)",
+    default = None
+)
+args = parser.parse_args()
+
+sim = simulation.Simulation()
+events = sim.backward(10000000, alpha=0.5)
+data = simulation.summarise(events)
+if args.raw is not None:
+    simulation.save_events(events, args.raw)
 
 with open("goupil.backward.pkl", "wb") as f:
     pickle.dump(data, f)
@@ -0,0 +1,133 @@
+#include "Folding.hh"
+
+#include <algorithm>
+#include <cmath>
+#include <thread>
+#include <vector>
+
+/* Width of the response band, in units of sigma */
+static const double BAND_WIDTH = 5.0;
+
+/* Banded response matrix, stored per column (i.e. per true energy bin) */
+struct folding_response {
+    size_t size;
+    std::vector<size_t> first;
+    std::vector<std::vector<double> > coefficients;
+};
+
+static double NormalCdf(double x) {
+    return 0.5 * std::erfc(-x / std::sqrt(2.0));
+}
+
+struct folding_response * folding_response_new(
+    size_t size,
+    const double * edges,
+    double noise,
+    double stochastic,
+    double constant,
+    const double * efficiency,
+    int density) {
+    auto response = new folding_response;
+    response->size = size;
+    response->first.resize(size);
+    response->coefficients.resize(size);
+
+    for (size_t j = 0; j < size; j++) {
+        const double energy = 0.5 * (edges[j] + edges[j + 1]);
+        const double widthj = edges[j + 1] - edges[j];
+        const double sigma = std::sqrt(noise * noise +
+            stochastic * stochastic * energy +
+            constant * constant * energy * energy);
+        const double eff = (efficiency == nullptr) ? 1.0 : efficiency[j];
+
+        auto && coefficients = response->coefficients[j];
+        if (!(sigma > 0.0)) {
+            /* No smearing */
+            response->first[j] = j;
+            coefficients.push_back(eff);
+            continue;
+        }
+
+        /* Locate the band, by bisection of edges */
+        const double emin = energy - BAND_WIDTH * sigma;
+        const double emax = energy + BAND_WIDTH * sigma;
+        size_t i0 = std::upper_bound(edges, edges + size + 1, emin) - edges;
+        i0 = (i0 > 0) ? i0 - 1 : 0;
+        size_t i1 = std::lower_bound(edges, edges + size + 1, emax) - edges;
+        i1 = std::min(i1, size);
+
+        response->first[j] = i0;
+        double cdf0 = NormalCdf((edges[i0] - energy) / sigma);
+        for (size_t i = i0; i < i1; i++) {
+            const double cdf1 = NormalCdf((edges[i + 1] - energy) / sigma);
+            double c = eff * (cdf1 - cdf0);
+            if (density) {
+                c *= widthj / (edges[i + 1] - edges[i]);
+            }
+            coefficients.push_back(c);
+            cdf0 = cdf1;
+        }
+    }
+
+    return response;
+}
+
+void folding_response_destroy(struct folding_response * response) {
+    delete response;
+}
+
+static void ApplyRange(const struct folding_response * response,
+        size_t begin, size_t end, const double * values, double * result,
+        int squared) {
+    const size_t n = response->size;
+    for (size_t h = begin; h < end; h++) {
+        const double * x = values + h * n;
+        double * y = result + h * n;
+        std::fill(y, y + n, 0.0);
+        for (size_t j = 0; j < n; j++) {
+            if (x[j] == 0.0) continue;
+            auto && coefficients = response->coefficients[j];
+            double * yj = y + response->first[j];
+            if (squared) {
+                for (size_t k = 0; k < coefficients.size(); k++) {
+                    yj[k] += coefficients[k] * coefficients[k] * x[j];
+                }
+            } else {
+                for (size_t k = 0; k < coefficients.size(); k++) {
+                    yj[k] += coefficients[k] * x[j];
+                }
+            }
+        }
+    }
+}
+
+void folding_response_apply(
+    const struct folding_response * response,
+    size_t histograms,
+    const double * values,
+    double * result,
+    int squared,
+    int threads) {
+    if (threads <= 0) {
+        threads = std::max(1U, std::thread::hardware_concurrency());
+    }
+    const size_t nt = std::min((size_t)threads, histograms);
+    if (nt <= 1) {
+        ApplyRange(response, 0, histograms, values, result, squared);
+        return;
+    }
+
+    /* Share histograms between threads */
+    std::vector<std::thread> workers;
+    const size_t chunk = histograms / nt, remainder = histograms % nt;
+    size_t begin = 0;
+    for (size_t t = 0; t < nt; t++) {
+        const size_t end = begin + chunk + ((t < remainder) ? 1 : 0);
+        workers.emplace_back(ApplyRange, response, begin, end, values,
+            result, squared);
+        begin = end;
+    }
+    for (auto && worker: workers) {
+        worker.join();
+    }
+}
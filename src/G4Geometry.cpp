@@ -7,14 +7,25 @@
 #include "G4PVPlacement.hh"
 #include "G4VPhysicalVolume.hh"
 #include "G4VUserDetectorConstruction.hh"
+#include "globals.hh"
 #include "Randomize.hh"
 /* Goupil interface */
 #include "G4Goupil.hh"
 
+#include <algorithm>
+#include <set>
+
 #ifndef M_PI
 #define M_PI 3.1415926535897
 #endif
 
+/* Minimum energy of backward states, in MeV */
+static const double BACKWARD_EMIN = 1E-02;
+
+/* Place a unique volume, with its own solid and logical volume. Repeated
+ * components (e.g. detector arrays or building grids) should rather be placed
+ * with DetectorConstruction::PlaceInstance, using the same name for all
+ * copies, which then share a single solid and logical volume. */
 static G4LogicalVolume * PlaceInVolume(const std::string& name,
         G4double dim[3], G4Material * material,
         G4RotationMatrix * rot, G4ThreeVector pos,
@@ -120,6 +131,42 @@ G4LogicalVolume * PlaceInVolume(const std::string& name,
     return logicalVolume;
 }
 
+G4LogicalVolume * DetectorConstruction::PlaceInstance(const std::string& name,
+        G4double dim[3], G4Material * material,
+        G4RotationMatrix * rot, G4ThreeVector pos,
+        G4LogicalVolume * motherVolume, G4int copyNo) {
+    auto && solid = this->solids[{ dim[0], dim[1], dim[2] }];
+    if (solid == nullptr) {
+        solid = new G4Box(name, 0.5*dim[0], 0.5*dim[1], 0.5*dim[2]);
+    }
+    auto && logicalVolume = this->instances[name];
+    if (logicalVolume == nullptr) {
+        logicalVolume = new G4LogicalVolume(solid, material, name);
+    } else if ((logicalVolume->GetSolid() != solid) ||
+               (logicalVolume->GetMaterial() != material)) {
+        /* A component must be identical for all of its copies */
+        const std::string msg = "inconsistent copy of component " + name;
+        G4Exception("DetectorConstruction::PlaceInstance", "Geometry001",
+            FatalException, msg.c_str());
+    }
+    new G4PVPlacement(
+        rot,
+        pos,
+        logicalVolume,
+        name,
+        motherVolume,
+        false,
+        copyNo
+    );
+    return logicalVolume;
+}
+
+void DetectorConstruction::DropInstances() {
+    /* The volumes themselves are deleted by G4Goupil::DropGeometry */
+    this->solids.clear();
+    this->instances.clear();
+}
+
 void DetectorConstruction::RandomiseState(struct goupil_state * state) {
     const double cosTheta = 2.0 * G4UniformRand() - 1.0;
     const double sinTheta = std::sqrt(1.0 - cosTheta*cosTheta);
@@ -153,15 +200,65 @@ void DetectorConstruction::RandomiseState(struct goupil_state * state) {
     
     /* Set energy */    
     state->energy = this->spectrum.back().first;
+    state->weight = 1.0;
     const double u = G4UniformRand();
-    for (auto pair: this->spectrum) {
-        if (u <= pair.second) {
-            state->energy = pair.first;
-            break;
+    if (this->biased) {
+        const size_t n = this->spectrum.size();
+        size_t i;
+        for (i = 0; i < n - 1; i++) {
+            if (u <= this->biasCdf[i]) break;
+        }
+        state->energy = this->spectrum[i].first;
+        state->weight = this->biasWeight[i];
+    } else {
+        for (auto pair: this->spectrum) {
+            if (u <= pair.second) {
+                state->energy = pair.first;
+                break;
+            }
         }
     }
 }
 
+size_t DetectorConstruction::GetLines(double * energies, double * intensities) {
+    double cdf = 0.0;
+    for (size_t i = 0; i < this->spectrum.size(); i++) {
+        if (energies != nullptr) {
+            energies[i] = this->spectrum[i].first;
+        }
+        if (intensities != nullptr) {
+            intensities[i] = this->spectrum[i].second - cdf;
+        }
+        cdf = this->spectrum[i].second;
+    }
+    return this->spectrum.size();
+}
+
+int DetectorConstruction::SetLineBias(size_t size, const double * factors) {
+    this->biased = false;
+    if (factors == nullptr) return 0;
+
+    /* Biased probabilities, q_i ~ p_i * f_i */
+    const size_t n = this->spectrum.size();
+    if (size != n) return -1;
+    decltype(this->biasWeight) p;
+    this->GetLines(nullptr, p.data());
+    double norm = 0.0;
+    for (size_t i = 0; i < n; i++) {
+        if (!(factors[i] > 0.0)) return -1;
+        norm += p[i] * factors[i];
+    }
+    double cdf = 0.0;
+    for (size_t i = 0; i < n; i++) {
+        const double q = p[i] * factors[i] / norm;
+        cdf += q;
+        this->biasCdf[i] = cdf;
+        this->biasWeight[i] = p[i] / q;
+    }
+    this->biased = true;
+    return 0;
+}
+
 double DetectorConstruction::RandomiseBackward(
     double alpha, struct goupil_state * state) {
     // Sample face according to respective surfaces.
@@ -209,7 +306,10 @@ double DetectorConstruction::RandomiseBackward(
 
     // Sample source energy.  
     double source_energy = this->spectrum.back().first;
-    {
+    double energy;
+    if (!this->windows.empty()) {
+        source_energy = this->RandomiseWindowed(alpha, &energy, &w);
+    } else {
         const double zeta = G4UniformRand();
         for (auto pair: this->spectrum) {
             if (zeta <= pair.second) {
@@ -217,18 +317,17 @@ double DetectorConstruction::RandomiseBackward(
                 break;
             }
         }
-    }
 
-    double energy;
-    if (G4UniformRand() < alpha) {
-        energy = source_energy;
-        w /= alpha;
-    } else {
-        // Sample state energy.
-        const double emin = 1E-02;
-        const double lnr = std::log(source_energy / emin);
-        energy = emin * std::exp(lnr * G4UniformRand());
-        w *= energy * lnr / (1.0 - alpha);
+        if (G4UniformRand() < alpha) {
+            energy = source_energy;
+            w /= alpha;
+        } else {
+            // Sample state energy.
+            const double emin = BACKWARD_EMIN;
+            const double lnr = std::log(source_energy / emin);
+            energy = emin * std::exp(lnr * G4UniformRand());
+            w *= energy * lnr / (1.0 - alpha);
+        }
     }
     
     // Set state.
@@ -244,24 +343,177 @@ double DetectorConstruction::RandomiseBackward(
     return source_energy;
 }
 
+int DetectorConstruction::SetWindows(size_t size, const double * windows) {
+    /* Merge overlapping windows */
+    this->windows.clear();
+    std::vector<std::pair<double, double> > sorted;
+    for (size_t i = 0; i < size; i++) {
+        const double emin = std::max(windows[2 * i], BACKWARD_EMIN);
+        const double emax = windows[2 * i + 1];
+        if (emax > emin) {
+            sorted.push_back(std::make_pair(emin, emax));
+        }
+    }
+    std::sort(sorted.begin(), sorted.end());
+    for (auto && window: sorted) {
+        if (!this->windows.empty() &&
+            (window.first <= this->windows.back().second)) {
+            this->windows.back().second = std::max(
+                this->windows.back().second, window.second);
+        } else {
+            this->windows.push_back(window);
+        }
+    }
+    if (this->windows.empty()) return 0;
+
+    /* Tabulate, per line, the (log) length of windows below the line
+     * energy and whether the line itself is observed */
+    decltype(this->windowCdf) p;
+    this->GetLines(nullptr, p.data());
+    double cdf = 0.0;
+    for (size_t i = 0; i < this->spectrum.size(); i++) {
+        const double source = this->spectrum[i].first;
+        double length = 0.0;
+        bool line = false;
+        for (auto && window: this->windows) {
+            if (window.first < source) {
+                length += std::log(std::min(window.second, source) /
+                                   window.first);
+            }
+            if ((source >= window.first) && (source <= window.second)) {
+                line = true;
+            }
+        }
+        this->windowLength[i] = length;
+        this->windowLine[i] = line;
+        if ((length > 0.0) || line) {
+            cdf += p[i];
+        }
+        this->windowCdf[i] = cdf;
+    }
+
+    /* Source lines are only sampled if they might contribute to windows */
+    if (!(cdf > 0.0)) {
+        this->windows.clear();
+        return -1;
+    }
+    this->windowNorm = cdf;
+    for (auto && c: this->windowCdf) {
+        c /= cdf;
+    }
+    return 0;
+}
+
+double DetectorConstruction::RandomiseWindowed(
+    double alpha, double * energy, double * weight) {
+    const size_t n = this->spectrum.size();
+
+    // Sample a contributing source line.
+    const double zeta = G4UniformRand();
+    size_t i = n - 1;
+    for (size_t j = 0; j < n; j++) {
+        if (!this->windowLine[j] && !(this->windowLength[j] > 0.0)) continue;
+        i = j;
+        if (zeta <= this->windowCdf[j]) break;
+    }
+    const double source_energy = this->spectrum[i].first;
+    *weight *= this->windowNorm;
+
+    // Probability to select the discrete line.
+    const double length = this->windowLength[i];
+    if (!this->windowLine[i]) {
+        alpha = 0.0;
+    } else if (!(length > 0.0)) {
+        alpha = 1.0;
+    }
+
+    if ((alpha >= 1.0) || ((alpha > 0.0) && (G4UniformRand() < alpha))) {
+        *energy = source_energy;
+        *weight /= alpha;
+    } else {
+        // Sample state energy, log-uniformly over windows. Rounding
+        // overshoots fall back to the upper edge of the last window.
+        double r = length * G4UniformRand();
+        for (auto && window: this->windows) {
+            if (window.first >= source_energy) break;
+            const double emax = std::min(window.second, source_energy);
+            const double li = std::log(emax / window.first);
+            if (r <= li) {
+                *energy = window.first * std::exp(r);
+                break;
+            }
+            *energy = emax;
+            r -= li;
+        }
+        *weight *= *energy * length / (1.0 - alpha);
+    }
+
+    return source_energy;
+}
+
+double DetectorConstruction::SourceNormalisation(double lambda) {
+    const double airArea = this->airSize[0] * this->airSize[1] / CLHEP::cm2;
+    const double airHeight = this->airSize[2] / CLHEP::cm;
+    const double detArea =
+        this->detectorSize[0] * this->detectorSize[1] / CLHEP::cm2;
+    const double detHeight = this->detectorSize[2] / CLHEP::cm;
+    const double detBottom = (this->detectorOffset - 0.5 * (
+        this->groundSize[2] - this->airSize[2] + this->detectorSize[2])) /
+        CLHEP::cm;
+
+    if (lambda == 0.0) {
+        return airArea * airHeight - detArea * detHeight;
+    } else {
+        /* Integrate over the air volume, excluding the detector */
+        const double air = -airArea * std::expm1(-lambda * airHeight) / lambda;
+        const double det = -detArea * std::exp(-lambda * detBottom) *
+            std::expm1(-lambda * detHeight) / lambda;
+        return air - det;
+    }
+}
+
 /* Goupil interface */
 const G4VPhysicalVolume * G4Goupil::NewGeometry() {
     /* Build the geometry and return the top "World" volume */
     return DetectorConstruction::Singleton()->Construct();
 }
 
-void G4Goupil::DropGeometry(const G4VPhysicalVolume * volume) {
-    /* Delete any sub-volume(s) */
+static void CollectVolumes(const G4VPhysicalVolume * volume,
+        std::set<const G4VPhysicalVolume *> & physicals,
+        std::set<G4LogicalVolume *> & logicals) {
+    physicals.insert(volume);
     auto && logical = volume->GetLogicalVolume();
-    while (logical->GetNoDaughters()) {
-        auto daughter = logical->GetDaughter(0);
-        logical->RemoveDaughter(daughter);
-        G4Goupil::DropGeometry(daughter);
-    }
-    /* Delete this volume */
-    delete logical->GetSolid();
-    delete logical;
-    delete volume;
+    if (!logicals.insert(logical).second) {
+        /* Shared logical volume, already visited */
+        return;
+    }
+    for (size_t i = 0, n = logical->GetNoDaughters(); i < n; i++) {
+        CollectVolumes(logical->GetDaughter(i), physicals, logicals);
+    }
+}
+
+void G4Goupil::DropGeometry(const G4VPhysicalVolume * volume) {
+    /* Collect all volumes, since logical volumes (and solids) might be
+     * shared between several placements */
+    std::set<const G4VPhysicalVolume *> physicals;
+    std::set<G4LogicalVolume *> logicals;
+    CollectVolumes(volume, physicals, logicals);
+
+    /* Delete all volumes, once */
+    std::set<G4VSolid *> solids;
+    for (auto && logical: logicals) {
+        solids.insert(logical->GetSolid());
+    }
+    for (auto && physical: physicals) {
+        delete physical;
+    }
+    for (auto && logical: logicals) {
+        delete logical;
+    }
+    for (auto && solid: solids) {
+        delete solid;
+    }
+    DetectorConstruction::Singleton()->DropInstances();
 }
 
 static void InitialisePrng() {
@@ -283,12 +535,28 @@ __attribute__((constructor)) static void initialize() {
     InitialisePrng();
 }
 
+void g4randomize_seed(unsigned long seed) {
+    G4Random::setTheSeed(seed);
+}
+
 void g4randomize_states(size_t size, struct goupil_state * states) {
     for (; size > 0; size--, states++) {
         DetectorConstruction::Singleton()->RandomiseState(states);
     }
 }
 
+int g4randomize_bias(size_t size, const double * factors) {
+    return DetectorConstruction::Singleton()->SetLineBias(size, factors);
+}
+
+size_t g4randomize_lines(double * energies, double * intensities) {
+    return DetectorConstruction::Singleton()->GetLines(energies, intensities);
+}
+
+int g4randomize_windows(size_t size, const double * windows) {
+    return DetectorConstruction::Singleton()->SetWindows(size, windows);
+}
+
 void g4randomize_backward(
     double alpha,
     size_t size,
@@ -307,4 +575,28 @@ double g4randomize_source_volume(void) {
     const double detVolume = detSize[0] * detSize[1] * detSize[2];
     return (airVolume - detVolume) / CLHEP::cm3;
 }
+
+void g4reweight_exponential(
+    size_t n_lambdas,
+    const double * lambdas,
+    size_t size,
+    const struct goupil_state * states,
+    double * weights) {
+    /* Compute the likelihood ratios of an exponential source density w.r.t.
+     * the uniform one, for all states (primaries) and all lambda values.
+     * Weights are stored per lambda value, i.e. weights[k * size + i]. */
+    auto detector = DetectorConstruction::Singleton();
+    const double ground = 0.5 * (detector->groundSize[2] -
+        detector->airSize[2]) / CLHEP::cm;
+    const double volume = g4randomize_source_volume();
+    for (size_t k = 0; k < n_lambdas; k++) {
+        const double lambda = lambdas[k];
+        const double r = volume / detector->SourceNormalisation(lambda);
+        double * wk = weights + k * size;
+        for (size_t i = 0; i < size; i++) {
+            const double h = states[i].position.z - ground;
+            wk[i] = r * std::exp(-lambda * h);
+        }
+    }
+}
 }